@@ -1,35 +1,399 @@
-from PIL import Image
+"""Asset compiler: packs images into one binary asset pack for race_game.c.
+The host build maps the pack file, the board build embeds the same bytes as
+the asset_pack array.
+
+    python3 color_array.py resources/assets.txt -o resources/assets.pak --embed race_game.c
+    python3 color_array.py art/ --dither floyd --header assets.h
+
+Inputs are manifests, image files or directories of images; every output
+(pack file, C header, embedded array) is written from the same pack, built
+once. Images that are not in a manifest are named after their file and use
+the --encoding, --colors and --dither defaults.
+
+Pack layout, little endian, every section 4 byte aligned:
+
+    header     "PRPK" | version u32 | asset count u32 | directory offset u32
+    directory  name char[16] | width u16 | height u16 | encoding u16 | palette size u16 |
+               palette offset u32 | rows offset u32 | data offset u32 | data size u32
+    sections   RGB565 palette, row offsets (height + 1, relative to data), pixel data
+
+Raw assets hold RGB565 pixels. RLE rows are independent packet sequences, so
+draw_asset can decode any range of rows straight into the framebuffer:
+
+    header < 0x80   run of header + 1 copies of the next pixel
+    header >= 0x80  header - 0x7F literal pixels follow
+
+An RLE pixel is a one byte palette index when the image has at most 256
+colors (or is quantized to the manifest's palette size), otherwise an RGB565
+word.
+
+Dithering (ordered 4x4 Bayer or Floyd-Steinberg) is applied before the color
+depth is reduced, to RGB565 or to the palette. Pure black is the sprite
+transparency key, so in RGB565 output it is never dithered and takes no
+diffused error.
+"""
+import argparse
+import os
+import re
+import struct
+import sys
+import time
+
 import numpy as np
+from PIL import Image
+
+MAX_RUN = 128
+MIN_RUN = 3  # shorter repeats are cheaper as literals
+PACK_MAGIC = b'PRPK'
+PACK_VERSION = 1
+NAME_LENGTH = 16
+MAX_COLORS = 256  # palette indices are one byte
+ENCODING_RAW = 0
+ENCODING_RLE = 1
+HEADER = struct.Struct('<4sIII')
+ENTRY = struct.Struct('<16sHHHHIIII')
+IMAGE_TYPES = ('.png', '.bmp', '.gif', '.jpg', '.jpeg', '.ppm')
+DITHERS = ('none', 'ordered', 'floyd')
+CHANNEL_BITS = (5, 6, 5)
+BAYER4 = (np.array([[0, 8, 2, 10],
+                    [12, 4, 14, 6],
+                    [3, 11, 1, 9],
+                    [15, 7, 13, 5]], dtype=np.float32) + 0.5) / 16
+
+
+def channel_levels(bits):
+    """For one 565 channel: the 888 value each level displays as (bit replicated),
+    and for every 888 value its level below, the fraction of the way to the next
+    level and the nearest level."""
+    levels = np.arange(1 << bits)
+    values = levels << (8 - bits) | levels >> (2 * bits - 8)
+    v = np.arange(256)
+    below = np.searchsorted(values, v, 'right') - 1
+    above = np.minimum(below + 1, len(values) - 1)
+    fraction = np.where(above > below, (v - values[below]) / np.maximum(values[above] - values[below], 1), 0)
+    return values, below, fraction, np.where(fraction > 0.5, above, below)
+
+
+LEVELS = [channel_levels(bits) for bits in CHANNEL_BITS]
+
+
+def rgb565(rgb):
+    rgb = rgb.astype(np.uint16)
+    return (rgb[..., 0] >> 3) << 11 | (rgb[..., 1] >> 2) << 5 | rgb[..., 2] >> 3
+
+
+def bayer_threshold(height, width):
+    return np.tile(BAYER4, ((height + 3) // 4, (width + 3) // 4))[:height, :width]
+
+
+def floyd_steinberg(channel, values, nearest, keep):
+    """Error diffusion of one channel, returns levels. A pixel only depends on
+    pixels left of it and on the row above, up to one column to its right, so
+    the pixels on one line 2 * y + x = t are independent: each line is diffused
+    at once in NumPy, adding the errors in the order of a scan line by line."""
+    height, width = channel.shape
+    # one padding column on each side and a row below take the errors pushed
+    # off the image; a line is then every width-th element of the flat array
+    stride = width + 2
+    work = np.zeros((height + 1, stride))
+    work[:height, 1:-1] = channel
+    diffuse = np.zeros(work.shape)
+    diffuse[:height, 1:-1] = ~keep
+    work, diffuse = work.reshape(-1), diffuse.reshape(-1)
+    levels = np.zeros(work.shape, dtype=np.intp)
+    for t in range(2 * (height - 1) + width):
+        top, bottom = max(0, (t - width + 2) // 2), min(height - 1, t // 2)
+        first, end = top * width + t + 1, bottom * width + t + 2
+        value = work[first:end:width]
+        level = nearest[np.clip(np.floor(value + 0.5), 0, 255).astype(np.intp)]
+        levels[first:end:width] = level
+        error = (value - values[level]) * diffuse[first:end:width]
+        work[first + stride - 1:end + stride - 1:width] += error * 3 / 16
+        work[first + 1:end + 1:width] += error * 7 / 16
+        work[first + stride:end + stride:width] += error * 5 / 16
+        work[first + stride + 1:end + stride + 1:width] += error / 16
+    out = levels.reshape(height + 1, stride)[:height, 1:-1].astype(np.uint16)
+    out[keep] = 0
+    return out
+
+
+def reduce_rgb565(rgb, dither):
+    """RGB888 -> RGB565 words. Without dithering the low bits are dropped; the
+    dithered modes pick between the two 565 levels around each value, so
+    colors that are already exact in RGB565 come through unchanged."""
+    if dither == 'none':
+        return rgb565(rgb)
+    keep = ~rgb.any(-1)
+    word = np.zeros(rgb.shape[:2], dtype=np.uint16)
+    for channel, shift, (values, below, fraction, nearest) in zip(range(3), (11, 5, 0), LEVELS):
+        pixels = rgb[..., channel]
+        if dither == 'ordered':
+            levels = below[pixels] + (fraction[pixels] > bayer_threshold(*pixels.shape))
+        else:
+            levels = floyd_steinberg(pixels, values, nearest, keep)
+        word |= np.where(keep, 0, levels).astype(np.uint16) << shift
+    return word
+
+
+def map_to_palette(rgb, palette, dither):
+    """Palette index of every pixel; PIL does the nearest color search (and error diffusion) in C."""
+    palette_image = Image.new('P', (1, 1))
+    padded = np.concatenate([palette, np.repeat(palette[:1], 256 - len(palette), 0)])
+    palette_image.putpalette(padded.astype(np.uint8).reshape(-1).tolist())
+    if dither == 'ordered':
+        # the typical distance from a palette color to its nearest neighbour sets the dither amplitude
+        distances = np.sqrt(((palette[:, None, :].astype(np.float32) - palette[None, :, :]) ** 2).sum(-1))
+        np.fill_diagonal(distances, np.inf)
+        spread = np.median(distances.min(1))
+        threshold = bayer_threshold(*rgb.shape[:2])[..., None] - 0.5
+        rgb = np.clip(rgb + threshold * spread, 0, 255)
+    mode = Image.Dither.FLOYDSTEINBERG if dither == 'floyd' else Image.Dither.NONE
+    image = Image.fromarray(rgb.astype(np.uint8), 'RGB').quantize(palette=palette_image, dither=mode)
+    return np.minimum(np.array(image), len(palette) - 1).astype(np.uint8)
+
+
+def load_image(path, colors, dither='none'):
+    """Returns (pixels, palette): palette indices and RGB565 palette, or RGB565 words and None."""
+    img = Image.open(path).convert('RGB')
+    rgb = np.array(img)
+    if colors and dither != 'none' and len(np.unique(rgb565(rgb))) > 256:
+        palette, _ = median_cut_palette(img, rgb, colors)
+        return map_to_palette(rgb, palette, dither), rgb565(palette)
+
+    pixels = reduce_rgb565(rgb, dither)
+    unique, indices = np.unique(pixels, return_inverse=True)
+    if len(unique) <= 256:
+        return indices.reshape(pixels.shape).astype(np.uint8), unique
+    if colors:
+        palette, nearest = median_cut_palette(img, rgb, colors)
+        return nearest.reshape(pixels.shape).astype(np.uint8), rgb565(palette)
+    return pixels, None
+
+
+def median_cut_palette(img, rgb, colors):
+    """Returns (palette, nearest palette index of every pixel)."""
+    quantized = img.quantize(colors, method=Image.Quantize.MEDIANCUT, dither=Image.Dither.NONE)
+    palette = np.array(quantized.getpalette()[:3 * colors], dtype=np.float32).reshape(-1, 3)
+    keys = rgb.reshape(-1, 3).astype(np.uint32) @ np.array([1 << 16, 1 << 8, 1], dtype=np.uint32)
+    unique_keys, inverse, counts = np.unique(keys, return_inverse=True, return_counts=True)
+    unique_rgb = (unique_keys[:, None] >> np.array([16, 8, 0], dtype=np.uint32)) & 0xFF
+    palette, nearest = refine_palette(unique_rgb.astype(np.float32), counts, palette)
+    return palette, nearest[inverse.reshape(-1)]
+
+
+def refine_palette(colors, counts, palette, iterations=8):
+    """Lloyd (k-means) passes over the distinct colors, weighted by how often they occur.
+    Median cut alone leaves a few colors far from every palette entry."""
+    for step in range(iterations + 1):
+        # |c - p|^2 without the |c|^2 term, which is the same for every palette entry
+        nearest = ((palette ** 2).sum(1) - 2 * colors @ palette.T).argmin(1)
+        if step == iterations:
+            break
+        weight = np.bincount(nearest, counts, len(palette))
+        for channel in range(3):
+            total = np.bincount(nearest, counts * colors[:, channel], len(palette))
+            palette[:, channel] = np.where(weight > 0, total / np.maximum(weight, 1), palette[:, channel])
+    return np.rint(palette).astype(np.uint8), nearest
+
+
+def encode_row(row, pixel_bytes):
+    """RLE packets for one row. NumPy finds the runs of equal pixels, so the
+    Python loop only visits runs, not pixels."""
+    raw = row.astype('<u1' if pixel_bytes == 1 else '<u2').tobytes()
+    starts = np.flatnonzero(np.r_[True, row[1:] != row[:-1]])
+    lengths = np.diff(np.r_[starts, len(row)])
+    out = bytearray()
+    literal_start = literal_end = 0
+
+    def flush():
+        for i in range(literal_start, literal_end, MAX_RUN):
+            count = min(MAX_RUN, literal_end - i)
+            out.append(0x7F + count)
+            out.extend(raw[i * pixel_bytes:(i + count) * pixel_bytes])
+
+    for start, length in zip(starts.tolist(), lengths.tolist()):
+        while length >= MIN_RUN:
+            count = min(length, MAX_RUN)
+            flush()
+            out.append(count - 1)
+            out.extend(raw[start * pixel_bytes:(start + 1) * pixel_bytes])
+            literal_start = literal_end = start = start + count
+            length -= count
+        literal_end = start + length  # short repeats join the literals
+    flush()
+    return bytes(out)
+
+
+def encode_asset(path, encoding, colors, dither):
+    """Returns (width, height, palette, rows, data) for one image."""
+    if encoding == 'raw':
+        pixels = reduce_rgb565(np.array(Image.open(path).convert('RGB')), dither)
+        return pixels.shape[1], pixels.shape[0], None, None, pixels.astype('<u2').tobytes()
+
+    pixels, palette = load_image(path, colors, dither)
+    pixel_bytes = 1 if palette is not None else 2
+    rows, data = [], bytearray()
+    for row in pixels:
+        rows.append(len(data))
+        data += encode_row(row, pixel_bytes)
+    rows.append(len(data))
+    return pixels.shape[1], pixels.shape[0], palette, rows, bytes(data)
+
+
+def read_manifest(path, defaults):
+    """Lines of "name image raw|rle [palette size] [none|ordered|floyd]"."""
+    assets = []
+    with open(path) as file:
+        for line in file:
+            fields = line.split('#')[0].split()
+            if not fields:
+                continue
+            name, image, encoding = fields[:3]
+            colors, dither = 0, defaults.dither
+            for option in fields[3:]:
+                if option.isdigit():
+                    colors = int(option)
+                    if not 1 <= colors <= MAX_COLORS:
+                        sys.exit(f'{path}: palette size of "{name}" must be 1 to {MAX_COLORS}')
+                elif option in DITHERS:
+                    dither = option
+                else:
+                    encoding = None
+            if encoding not in ('raw', 'rle') or len(name) >= NAME_LENGTH:
+                sys.exit(f'{path}: bad entry "{line.strip()}"')
+            assets.append((name, os.path.join(os.path.dirname(path), image), encoding, colors, dither))
+    return assets
+
+
+def collect_assets(inputs, defaults):
+    """Expands manifests, directories and single images into asset entries."""
+    assets = []
+    for path in inputs:
+        if os.path.isdir(path):
+            images = sorted(os.path.join(path, f) for f in os.listdir(path) if f.lower().endswith(IMAGE_TYPES))
+        elif path.lower().endswith(IMAGE_TYPES):
+            images = [path]
+        else:
+            assets += read_manifest(path, defaults)
+            continue
+        for image in images:
+            name = os.path.splitext(os.path.basename(image))[0]
+            if len(name) >= NAME_LENGTH:
+                sys.exit(f'{image}: asset names are limited to {NAME_LENGTH - 1} characters')
+            assets.append((name, image, defaults.encoding, defaults.colors, defaults.dither))
+
+    names = [asset[0] for asset in assets]
+    duplicates = sorted({name for name in names if names.count(name) > 1})
+    if duplicates:
+        sys.exit(f'duplicate asset names: {", ".join(duplicates)}')
+    return assets
+
+
+def align(blob):
+    blob += bytes(-len(blob) % 4)
+
+
+def build_pack(assets):
+    directory_offset = HEADER.size
+    pack = bytearray(HEADER.pack(PACK_MAGIC, PACK_VERSION, len(assets), directory_offset))
+    pack += bytes(ENTRY.size * len(assets))
+
+    for index, (name, path, encoding, colors, dither) in enumerate(assets):
+        start = time.perf_counter()
+        width, height, palette, rows, data = encode_asset(path, encoding, colors, dither)
+        palette_offset = rows_offset = 0
+        if palette is not None:
+            palette_offset = len(pack)
+            pack += palette.astype('<u2').tobytes()
+            align(pack)
+        if rows is not None:
+            rows_offset = len(pack)
+            pack += np.array(rows, dtype='<u4').tobytes()
+        data_offset = len(pack)
+        pack += data
+        align(pack)
+
+        entry = ENTRY.pack(name.encode(), width, height,
+                           ENCODING_RLE if encoding == 'rle' else ENCODING_RAW,
+                           len(palette) if palette is not None else 0,
+                           palette_offset, rows_offset, data_offset, len(data))
+        offset = directory_offset + index * ENTRY.size
+        pack[offset:offset + ENTRY.size] = entry
+        milliseconds = (time.perf_counter() - start) * 1000
+        print(f'{name}: {width}x{height} {encoding}, {len(data)} bytes (raw {width * height * 2}), '
+              f'{milliseconds:.1f} ms', file=sys.stderr)
+    return bytes(pack)
+
+
+def pack_array(pack, pack_name):
+    """C definition of the asset_pack array, formatted with one NumPy pass."""
+    padded = np.frombuffer(pack + bytes(-len(pack) % 20), dtype=np.uint8).reshape(-1, 20)
+    text = np.char.add('0x', np.char.zfill(np.char.upper(np.char.mod('%x', padded)), 2))
+    lines = [', '.join(row) for row in text.tolist()]
+    lines[-1] = ', '.join(text[-1][:len(pack) % 20 or 20].tolist())
+    return (f'// {pack_name}, generated by color_array.py\n'
+            + f'const uint32_t asset_pack_size = {len(pack)};\n'
+            + f'const uint8_t asset_pack[{len(pack)}] __attribute__((aligned(4), section(".rodata.assets"))) = {{\n    '
+            + ',\n    '.join(lines) + '\n};\n')
+
+
+def write_header(header_path, pack, pack_name):
+    guard = re.sub(r'\W', '_', os.path.basename(header_path)).upper()
+    with open(header_path, 'w') as file:
+        file.write(f'#ifndef {guard}\n#define {guard}\n\n#include <stdint.h>\n\n'
+                   + pack_array(pack, pack_name) + f'\n#endif // {guard}\n')
 
-def image_to_string(image_path, output_path):
-    img = Image.open(image_path)
 
-    # Optionally resize the image to 240x320
-    #img_resized = img.resize((320, 240))
-    img_resized = img
+def embed_pack(source_path, pack, pack_name):
+    """Swaps the asset_pack array between the markers in source_path."""
+    begin, end = '// BEGIN ASSET PACK\n', '// END ASSET PACK\n'
+    block = begin + pack_array(pack, pack_name) + end
+    with open(source_path) as file:
+        source = file.read()
+    pattern = re.compile(re.escape(begin) + '.*?' + re.escape(end), re.S)
+    if pattern.search(source):
+        source = pattern.sub(lambda _: block, source)
+    else:
+        source = source.rstrip('\n') + '\n\n' + block
+    with open(source_path, 'w') as file:
+        file.write(source)
 
-    if img_resized.mode != 'RGB':
-        img_resized = img_resized.convert('RGB')
 
-    img_array = np.array(img_resized)
+def palette_size(text):
+    colors = int(text) if text.isdigit() else 0
+    if not 1 <= colors <= MAX_COLORS:
+        raise argparse.ArgumentTypeError(f'palette size must be 1 to {MAX_COLORS}')
+    return colors
 
-    
-    array_string = "uint16_t image[height][width] = {\n" # Change width and height
-    for row in img_array:
-        array_string += "    {"
-        for pixel in row:
 
-            r, g, b = pixel
-            color_16bit = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3)
-            array_string += str(color_16bit) + ", "
-        array_string = array_string[:-2] + "},\n"
-    array_string = array_string[:-2] + "\n};"
+def main():
+    parser = argparse.ArgumentParser(description='Build the binary asset pack for race_game.c')
+    parser.add_argument('inputs', nargs='+', metavar='INPUT',
+                        help='manifest ("name image raw|rle [palette size] [dither]" lines), image or directory')
+    parser.add_argument('-o', '--output', help='pack file to write')
+    parser.add_argument('--header', metavar='FILE', help='write the asset_pack array as a C header')
+    parser.add_argument('--embed', metavar='FILE', help='update the asset_pack array in FILE')
+    parser.add_argument('--encoding', choices=('raw', 'rle'), default='rle', help='for images outside a manifest')
+    parser.add_argument('--colors', type=palette_size, default=0,
+                        help=f'palette size (1 to {MAX_COLORS}) for images outside a manifest')
+    parser.add_argument('--dither', choices=DITHERS, default='none', help='default dithering')
+    args = parser.parse_args()
+    if not (args.output or args.header or args.embed):
+        parser.error('nothing to write, give -o, --header or --embed')
 
-    with open(output_path, 'w') as file:
-        file.write(array_string)
+    start = time.perf_counter()
+    pack = build_pack(collect_assets(args.inputs, args))
+    pack_name = os.path.basename(args.output or 'assets.pak')
+    if args.output:
+        with open(args.output, 'wb') as file:
+            file.write(pack)
+    if args.header:
+        write_header(args.header, pack, pack_name)
+    if args.embed:
+        embed_pack(args.embed, pack, pack_name)
+    milliseconds = (time.perf_counter() - start) * 1000
+    print(f'{args.output or args.header or args.embed}: {len(pack)} bytes, {milliseconds:.1f} ms', file=sys.stderr)
 
-if "__name__" == "__main__":
-    image_path = "resources/cover.png"  
-    output_path = "cover.txt"  
 
-    image_to_string(image_path, output_path)
\ No newline at end of file
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,143 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "replay.h"
+
+// CONSTANTS
+#define HEADER_SIZE 24
+
+/**********************
+* FUNCTION PROTOTYPES *
+***********************/
+static void put_u32(uint8_t *buffer, uint32_t value);
+static uint32_t get_u32(const uint8_t *buffer);
+
+/**********************
+*   GLOBAL VARIABLES  *
+***********************/
+static FILE *record_file = NULL;
+static uint32_t record_step = 0;   // step of the last recorded event
+static uint32_t record_events = 0;
+
+static FILE *replay_file = NULL;
+static uint32_t replay_step = 0;
+static uint32_t replay_events = 0; // events left to read
+
+
+/*****************************
+*    FUNCTION DEFINITIONS    *
+******************************/
+
+bool record_open(const char *path){
+    record_file = fopen(path, "wb");
+    if(!record_file){
+        perror(path);
+        return false;
+    }
+
+    uint8_t header[HEADER_SIZE] = {0}; // rewritten by record_close
+    fwrite(header, 1, sizeof(header), record_file);
+    record_step = 0;
+    record_events = 0;
+    return true;
+}
+
+void record_key_event(uint32_t step, uint8_t code, uint8_t flags){
+    if(!record_file) return;
+
+    uint8_t buffer[8];
+    int length = 0;
+    uint32_t delta = step - record_step;
+    do {
+        buffer[length] = delta & 0x7F;
+        delta >>= 7;
+        if(delta) buffer[length] |= 0x80;
+        length++;
+    } while(delta);
+    buffer[length++] = code;
+    buffer[length++] = flags;
+
+    fwrite(buffer, 1, length, record_file);
+    record_step = step;
+    record_events++;
+}
+
+void record_close(uint32_t seed, uint32_t steps, uint32_t checksum){
+    if(!record_file) return;
+
+    uint8_t header[HEADER_SIZE];
+    memcpy(header, "PRRP", 4);
+    put_u32(header + 4, REPLAY_VERSION);
+    put_u32(header + 8, seed);
+    put_u32(header + 12, steps);
+    put_u32(header + 16, record_events);
+    put_u32(header + 20, checksum);
+
+    fseek(record_file, 0, SEEK_SET);
+    fwrite(header, 1, sizeof(header), record_file);
+    fclose(record_file);
+    record_file = NULL;
+}
+
+bool replay_open(const char *path, uint32_t *seed, uint32_t *steps, uint32_t *checksum){
+    replay_file = fopen(path, "rb");
+    if(!replay_file){
+        perror(path);
+        return false;
+    }
+
+    uint8_t header[HEADER_SIZE];
+    if(fread(header, 1, sizeof(header), replay_file) != sizeof(header) ||
+        memcmp(header, "PRRP", 4) || get_u32(header + 4) != REPLAY_VERSION){
+        fprintf(stderr, "%s: not a version %d replay\n", path, REPLAY_VERSION);
+        replay_close();
+        return false;
+    }
+    *seed = get_u32(header + 8);
+    *steps = get_u32(header + 12);
+    replay_events = get_u32(header + 16);
+    *checksum = get_u32(header + 20);
+    replay_step = 0;
+    return true;
+}
+
+// Returns false once every event has been read or the file is truncated
+bool replay_next(uint32_t *step, uint8_t *code, uint8_t *flags){
+    if(!replay_file || replay_events == 0) return false;
+
+    uint32_t delta = 0;
+    int shift = 0, byte;
+    do {
+        byte = fgetc(replay_file);
+        if(byte == EOF || shift > 28) return false;
+        delta |= (uint32_t)(byte & 0x7F) << shift;
+        shift += 7;
+    } while(byte & 0x80);
+
+    int code_byte = fgetc(replay_file);
+    int flags_byte = fgetc(replay_file);
+    if(code_byte == EOF || flags_byte == EOF) return false;
+
+    replay_step += delta;
+    *step = replay_step;
+    *code = code_byte;
+    *flags = flags_byte;
+    replay_events--;
+    return true;
+}
+
+void replay_close(void){
+    if(replay_file) fclose(replay_file);
+    replay_file = NULL;
+}
+
+static void put_u32(uint8_t *buffer, uint32_t value){
+    for(int i = 0; i < 4; i++)
+        buffer[i] = value >> (8 * i);
+}
+
+static uint32_t get_u32(const uint8_t *buffer){
+    return buffer[0] | buffer[1] << 8 | buffer[2] << 16 | (uint32_t)buffer[3] << 24;
+}
@@ -0,0 +1,32 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Session recordings for the host build. A file holds the RNG seed, the
+// number of simulation steps, the checksum of the final game state and the
+// key events applied before each step:
+//
+//   header:  "PRRP" | version u32 | seed u32 | steps u32 | events u32 | checksum u32
+//   event:   step delta (LEB128) | scan code u8 | flags u8
+//
+// All integers are little endian.
+
+// CONSTANTS
+#define REPLAY_VERSION 1
+#define REPLAY_EXTENDED 0x01 // event flags
+#define REPLAY_RELEASED 0x02
+
+/**********************
+* FUNCTION PROTOTYPES *
+***********************/
+bool record_open(const char *path);
+void record_key_event(uint32_t step, uint8_t code, uint8_t flags);
+void record_close(uint32_t seed, uint32_t steps, uint32_t checksum);
+
+bool replay_open(const char *path, uint32_t *seed, uint32_t *steps, uint32_t *checksum);
+bool replay_next(uint32_t *step, uint8_t *code, uint8_t *flags);
+void replay_close(void);
+
+#endif // REPLAY_H
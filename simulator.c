@@ -0,0 +1,365 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "simulator.h"
+#include "replay.h"
+
+// CONSTANTS
+#define SIM_TIMER_CLOCK 100000 // timer cycles per emulated millisecond (100 MHz)
+#define SIM_DEFAULT_TICKS 20000
+#define PS2_IRQ 79
+#define TIMER_IRQ 72
+
+/**********************
+*       STRUCTS       *
+***********************/
+
+typedef struct {
+    uint32_t tick;    // emulated millisecond at which the bytes arrive
+    int length;
+    uint8_t bytes[8]; // raw scan code bytes, e.g. E0 F0 6B
+} SimKeyEvent;
+
+/**********************
+* FUNCTION PROTOTYPES *
+***********************/
+void handle_interrupt(int interrupt_ID); // race_game.c
+
+static void load_input_script(const char *path);
+static void push_PS2_byte(uint8_t byte);
+static void deliver_interrupts(void);
+static uint32_t elapsed_ms(void);
+static void print_usage(const char *name);
+
+/**********************
+*   GLOBAL VARIABLES  *
+***********************/
+SimHardware sim_hw;
+const char *sim_replay_path = NULL;
+bool sim_benchmark = false;
+bool sim_seed_given = false;
+uint32_t sim_seed = 0;
+FILE *sim_profile_file = NULL;
+const uint8_t *sim_asset_pack = NULL;
+uint32_t sim_asset_pack_size = 0;
+int sim_threads = 0;
+int sim_scale = 1;
+uint16_t *sim_upscaled = NULL;
+int sim_batch = 0;
+
+static bool irq_enabled = false;
+static uintptr_t front_buffer;       // shadow of the front buffer register while a swap is pending
+static uint32_t frames = 0;
+static uint32_t tick = 0;            // emulated time in ms
+static uint32_t max_ticks = SIM_DEFAULT_TICKS;
+static uint32_t timer_count = 0;     // ms since the last timer timeout
+static bool realtime = false;
+static struct timespec start_time;
+
+static SimKeyEvent *script = NULL;
+static int script_length = 0;
+static int script_pos = 0;
+
+static uint8_t ps2_fifo[SIM_PS2_FIFO_SIZE];
+static int ps2_head = 0, ps2_count = 0;
+
+static const char *final_dump = NULL;
+static const char *dump_prefix = "frame";
+static uint32_t dump_every = 0;
+static bool upscaled_back = false;  // sim_upscaled holds the frame in the back buffer
+static bool upscaled_front = false; // ... in the front buffer
+
+
+/*****************************
+*    FUNCTION DEFINITIONS    *
+******************************/
+
+void sim_init(int argc, char **argv){
+    for(int i = 1; i < argc; i++){
+        if(!strcmp(argv[i], "--ticks") && i + 1 < argc) max_ticks = strtoul(argv[++i], NULL, 0);
+        else if(!strcmp(argv[i], "--input") && i + 1 < argc) load_input_script(argv[++i]);
+        else if(!strcmp(argv[i], "--dump") && i + 1 < argc) final_dump = argv[++i];
+        else if(!strcmp(argv[i], "--dump-every") && i + 1 < argc) dump_every = strtoul(argv[++i], NULL, 0);
+        else if(!strcmp(argv[i], "--dump-prefix") && i + 1 < argc) dump_prefix = argv[++i];
+        else if(!strcmp(argv[i], "--realtime")) realtime = true;
+        else if(!strcmp(argv[i], "--record") && i + 1 < argc){
+            if(!record_open(argv[++i])) exit(1);
+        }
+        else if(!strcmp(argv[i], "--replay") && i + 1 < argc) sim_replay_path = argv[++i];
+        else if(!strcmp(argv[i], "--bench")) sim_benchmark = true;
+        else if(!strcmp(argv[i], "--threads") && i + 1 < argc){
+            sim_threads = atoi(argv[++i]);
+            if(sim_threads < 1){
+                fprintf(stderr, "simulator: --threads must be at least 1\n");
+                exit(1);
+            }
+        }
+        else if(!strcmp(argv[i], "--scale") && i + 1 < argc) sim_scale = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--batch") && i + 1 < argc) sim_batch = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--assets") && i + 1 < argc){
+            sim_asset_pack = sim_map_file(argv[++i], &sim_asset_pack_size);
+            if(!sim_asset_pack) exit(1);
+        }
+        else if(!strcmp(argv[i], "--profile") && i + 1 < argc){
+            sim_profile_file = fopen(argv[++i], "w");
+            if(!sim_profile_file){
+                perror(argv[i]);
+                exit(1);
+            }
+        }
+        else if(!strcmp(argv[i], "--seed") && i + 1 < argc){
+            sim_seed = strtoul(argv[++i], NULL, 0);
+            sim_seed_given = true;
+        }
+        else{
+            print_usage(argv[0]);
+            exit(strcmp(argv[i], "--help") ? 1 : 0);
+        }
+    }
+
+    sim_hw.pixel_buffer = calloc(SIM_PIXEL_WIDTH * SIM_PIXEL_HEIGHT, sizeof(uint16_t));
+    sim_hw.back_buffer = calloc(SIM_PIXEL_WIDTH * SIM_PIXEL_HEIGHT, sizeof(uint16_t));
+    sim_hw.char_buffer = calloc(SIM_CHAR_WIDTH * SIM_CHAR_HEIGHT, sizeof(char));
+    if(sim_scale < 1) sim_scale = 1;
+    if(sim_scale > 1) sim_upscaled = calloc(320 * 240 * sim_scale * sim_scale, sizeof(uint16_t));
+    if(!sim_hw.pixel_buffer || !sim_hw.back_buffer || !sim_hw.char_buffer || (sim_scale > 1 && !sim_upscaled)){
+        fprintf(stderr, "simulator: out of memory\n");
+        exit(1);
+    }
+    sim_hw.pixel_ctrl[0] = (uintptr_t)sim_hw.pixel_buffer;
+    sim_hw.pixel_ctrl[1] = (uintptr_t)sim_hw.pixel_buffer;
+    sim_hw.pixel_ctrl[2] = (240 << 16) | 320;
+    front_buffer = sim_hw.pixel_ctrl[0];
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+}
+
+// Advances emulated time and raises the timer and PS/2 interrupts that became
+// pending. Returns false once the requested number of ticks has elapsed.
+bool sim_poll(void){
+    uint32_t target = realtime ? elapsed_ms() : tick + 1;
+
+    while(tick < target && tick < max_ticks){
+        tick++;
+
+        while(script_pos < script_length && script[script_pos].tick <= tick){
+            for(int i = 0; i < script[script_pos].length; i++)
+                push_PS2_byte(script[script_pos].bytes[i]);
+            script_pos++;
+        }
+
+        uint32_t period = ((sim_hw.timer[3] & 0xFFFF) << 16 | (sim_hw.timer[2] & 0xFFFF)) / SIM_TIMER_CLOCK;
+        if((sim_hw.timer[1] & 0x4) && ++timer_count >= (period ? period : 1)){
+            timer_count = 0;
+            sim_hw.timer[0] |= 0x1; // TO bit
+        }
+        deliver_interrupts();
+
+        if(dump_every && tick % dump_every == 0){
+            char path[256];
+            snprintf(path, sizeof(path), "%s_%06u.ppm", dump_prefix, tick);
+            sim_dump_frame(path);
+        }
+    }
+
+    if(tick >= max_ticks){
+        if(final_dump) sim_dump_frame(final_dump);
+        printf("simulator: %u ticks, %u frames\n", tick, frames);
+        return false;
+    }
+    return true;
+}
+
+// Writing 1 to the front buffer register requests a swap; the emulated display
+// reaches vertical sync immediately, so the status S bit is never left set.
+void sim_vsync(void){
+    if(sim_hw.pixel_ctrl[0] == 1){
+        uintptr_t back = sim_hw.pixel_ctrl[1];
+        sim_hw.pixel_ctrl[1] = front_buffer;
+        front_buffer = back;
+        frames++;
+        upscaled_front = upscaled_back;
+        upscaled_back = false;
+    }
+    sim_hw.pixel_ctrl[0] = front_buffer;
+    sim_hw.pixel_ctrl[3] &= ~(uintptr_t)0x1;
+}
+
+int sim_read_PS2_data(void){
+    if(ps2_count == 0) return 0; // RVALID = 0
+
+    uint8_t byte = ps2_fifo[ps2_head];
+    ps2_head = (ps2_head + 1) % SIM_PS2_FIFO_SIZE;
+    ps2_count--;
+    return (ps2_count << 16) | 0x8000 | byte; // RAVAIL | RVALID | data
+}
+
+// Marks sim_upscaled as the frame the next swap shows
+void sim_present_upscaled(void){
+    upscaled_back = true;
+}
+
+// Blows the 320x240 back buffer up into sim_upscaled, for screens drawn at the
+// board's resolution
+void sim_upscale_back_buffer(void){
+    const uint16_t *back = (const uint16_t *)sim_hw.pixel_ctrl[1];
+    int width = 320 * sim_scale;
+    for(int y = 0; y < 240 * sim_scale; y++)
+        for(int x = 0; x < width; x++)
+            sim_upscaled[y * width + x] = back[y / sim_scale * SIM_PIXEL_WIDTH + x / sim_scale];
+}
+
+// Writes the visible 320x240 region of the front buffer as a binary PPM. With
+// --scale the image is scale times larger: the upscaled frame when the threaded
+// renderer drew the front buffer, otherwise the front buffer blown up.
+void sim_dump_frame(const char *path){
+    FILE *file = fopen(path, "wb");
+    if(!file){
+        perror(path);
+        return;
+    }
+
+    int width = 320 * sim_scale, height = 240 * sim_scale;
+    const uint16_t *front = (const uint16_t *)sim_hw.pixel_ctrl[0];
+    uint8_t *row = malloc(width * 3);
+    fprintf(file, "P6\n%d %d\n255\n", width, height);
+    for(int y = 0; y < height; y++){
+        for(int x = 0; x < width; x++){
+            uint16_t color = upscaled_front ? sim_upscaled[y * width + x] :
+                front[y / sim_scale * SIM_PIXEL_WIDTH + x / sim_scale];
+            row[x * 3 + 0] = ((color >> 11) & 0x1F) * 255 / 31;
+            row[x * 3 + 1] = ((color >> 5) & 0x3F) * 255 / 63;
+            row[x * 3 + 2] = (color & 0x1F) * 255 / 31;
+        }
+        fwrite(row, 1, width * 3, file);
+    }
+    free(row);
+    fclose(file);
+}
+
+// Maps a file read-only; the game reads assets straight from the mapped pages
+const uint8_t *sim_map_file(const char *path, uint32_t *size){
+    int fd = open(path, O_RDONLY);
+    struct stat info;
+    if(fd < 0 || fstat(fd, &info) < 0 || info.st_size == 0){
+        perror(path);
+        if(fd >= 0) close(fd);
+        return NULL;
+    }
+
+    void *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping stays valid
+    if(data == MAP_FAILED){
+        perror(path);
+        return NULL;
+    }
+    *size = info.st_size;
+    return data;
+}
+
+// Each line is "<tick> <hex byte>...", e.g. "1200 E0 F0 6B"; '#' starts a comment
+static void load_input_script(const char *path){
+    FILE *file = fopen(path, "r");
+    if(!file){
+        perror(path);
+        exit(1);
+    }
+
+    char line[256];
+    while(fgets(line, sizeof(line), file)){
+        char *cursor = strchr(line, '#');
+        if(cursor) *cursor = '\0';
+
+        SimKeyEvent event = {0};
+        char *end;
+        event.tick = strtoul(line, &end, 10);
+        if(end == line) continue;
+        for(cursor = end; event.length < 8; cursor = end){
+            unsigned long byte = strtoul(cursor, &end, 16);
+            if(end == cursor) break;
+            event.bytes[event.length++] = (uint8_t)byte;
+        }
+        if(event.length == 0) continue;
+
+        script = realloc(script, (script_length + 1) * sizeof(SimKeyEvent));
+        script[script_length++] = event;
+    }
+    fclose(file);
+}
+
+static void push_PS2_byte(uint8_t byte){
+    if(ps2_count == SIM_PS2_FIFO_SIZE) return; // the device drops bytes when full
+    ps2_fifo[(ps2_head + ps2_count) % SIM_PS2_FIFO_SIZE] = byte;
+    ps2_count++;
+}
+
+static void deliver_interrupts(void){
+    if(!irq_enabled) return;
+
+    if((sim_hw.timer[0] & 0x1) && (sim_hw.timer[1] & 0x1))
+        handle_interrupt(TIMER_IRQ);
+
+    // The PS/2 port keeps its interrupt asserted while the FIFO holds data
+    while(ps2_count > 0 && (sim_hw.ps2[1] & 0x1)){
+        int before = ps2_count;
+        handle_interrupt(PS2_IRQ);
+        if(ps2_count == before) break; // ISR did not drain anything
+    }
+}
+
+static uint32_t elapsed_ms(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start_time.tv_sec) * 1000 + (now.tv_nsec - start_time.tv_nsec) / 1000000;
+}
+
+static void print_usage(const char *name){
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  --ticks N          stop after N emulated milliseconds (default %d)\n"
+        "  --input FILE       scripted PS/2 input, lines of \"<tick> <hex bytes>\"\n"
+        "  --dump FILE        write the final frame as PPM\n"
+        "  --dump-every N     write a PPM every N ticks\n"
+        "  --dump-prefix P    file prefix for --dump-every (default \"frame\")\n"
+        "  --realtime         pace emulated time with the wall clock\n"
+        "  --seed N           seed the game RNG instead of using the ENTER time\n"
+        "  --record FILE      record the seed and key events of the session\n"
+        "  --replay FILE      replay a recording headless and verify its checksum\n"
+        "  --profile FILE     write per-frame stage times in us as CSV\n"
+        "  --bench            benchmark the rendering primitives and exit\n"
+        "  --assets FILE      map an asset pack instead of the built-in one\n"
+        "  --threads N        render frames with N threads (banded, work stealing)\n"
+        "  --scale S          with --threads, render at S times the resolution\n"
+        "  --batch N          step N games without rendering, report env-steps/s and exit\n",
+        name, SIM_DEFAULT_TICKS);
+}
+
+/*************************
+*   A9 / GIC STAND-INS   *
+**************************/
+
+void config_interrupt(int N, int CPU_target) {
+    (void)N;
+    (void)CPU_target;
+}
+
+void config_GIC(void) {
+}
+
+void enable_A9_interrupts(void) {
+    irq_enabled = true;
+}
+
+void disable_A9_interrupts(void) {
+    irq_enabled = false;
+}
+
+void set_A9_IRQ_stack(void) {
+}
@@ -0,0 +1,65 @@
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+// Host (Linux) backend for race_game.c. Compiling the game with -DSIMULATOR
+// points every MMIO base address at the emulated register blocks below, so the
+// game loop runs unchanged at native speed.
+
+// CONSTANTS
+#define SIM_PIXEL_WIDTH 512   // pixel buffer stride: (y << 10) + (x << 1)
+#define SIM_PIXEL_HEIGHT 256
+#define SIM_CHAR_WIDTH 128    // character buffer stride: (y << 7) + x
+#define SIM_CHAR_HEIGHT 64
+#define SIM_CHAR_COLUMNS 80   // visible part of the character buffer
+#define SIM_CHAR_ROWS 60
+#define SIM_PS2_FIFO_SIZE 256
+
+/**********************
+*       STRUCTS       *
+***********************/
+
+typedef struct {
+    uint16_t *pixel_buffer;           // heap allocated 512x256 RGB565 buffer (on-chip memory)
+    uint16_t *back_buffer;            // second buffer of the same size (SDRAM)
+    char *char_buffer;                // heap allocated 128x64 character buffer
+    volatile uintptr_t pixel_ctrl[4]; // front buffer, back buffer, resolution, status
+    volatile uint32_t timer[8];       // status, control, start low, start high, snapshots
+    volatile uint32_t ps2[2];         // data, control
+    volatile unsigned int hex0_3;
+    volatile unsigned int hex4_5;
+    volatile unsigned int leds;
+} SimHardware;
+
+/**********************
+* FUNCTION PROTOTYPES *
+***********************/
+void sim_init(int argc, char **argv);
+bool sim_poll(void);
+void sim_vsync(void);
+int sim_read_PS2_data(void);
+void sim_dump_frame(const char *path);
+const uint8_t *sim_map_file(const char *path, uint32_t *size);
+void sim_present_upscaled(void);
+void sim_upscale_back_buffer(void);
+
+/**********************
+*   GLOBAL VARIABLES  *
+***********************/
+extern SimHardware sim_hw;
+extern const char *sim_replay_path; // --replay: run headless instead of the game loop
+extern bool sim_benchmark;          // --bench: time the rendering primitives and exit
+extern bool sim_seed_given;         // --seed
+extern uint32_t sim_seed;
+extern FILE *sim_profile_file;      // --profile: per-frame stage times as CSV
+extern const uint8_t *sim_asset_pack; // --assets: memory mapped asset pack, NULL for the built-in one
+extern uint32_t sim_asset_pack_size;
+extern int sim_threads;             // --threads: render with a worker pool of this many threads
+extern int sim_scale;               // --scale: resolution multiplier of the threaded renderer
+extern uint16_t *sim_upscaled;      // (320 * sim_scale) x (240 * sim_scale) frame, when sim_scale > 1
+extern int sim_batch;               // --batch: step this many games without rendering and exit
+
+#endif // SIMULATOR_H